@@ -7,6 +7,25 @@
 #include <iomanip>
 #include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <ctime>
+#include <list>
+#include <unordered_map>
+#include <set>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <functional>
+#include <stdexcept>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
@@ -14,6 +33,16 @@ using namespace std;
 const string ROOT_USERNAME = "root";
 const string ROOT_PASSWORD = "sjtu";
 const int ROOT_PRIVILEGE = 7;
+const size_t BOOK_CACHE_CAPACITY = 512;
+const int DEFAULT_TOP_COUNT = 10;
+const size_t TRANSACTION_BLOCK_SIZE = 4096; // rows per journal block, a multiple of 64
+const uint64_t STORAGE_PAGE_SIZE = 4096;
+const char STORAGE_MAGIC[8] = {'B', 'K', 'S', 'T', 'O', 'R', 'E', '2'};
+const size_t INPUT_CHUNK_SIZE = 1 << 20;
+const size_t INPUT_QUEUE_CAPACITY = 4;      // chunks between reader and parser
+const size_t COMMAND_BATCH_SIZE = 256;      // commands handed over per batch
+const size_t COMMAND_QUEUE_CAPACITY = 64;   // batches between parser and executor
+const size_t STREAM_COMPACT_SLACK = 64;     // superseded records kept before a stream is rewritten
 
 // Data structures
 struct User {
@@ -26,44 +55,800 @@ struct User {
         : userID(id), password(pwd), username(name), privilege(priv) {}
 };
 
+// Interns repeated column values (authors, keyword segments) as 32-bit ids.
+// Id 0 is always the empty string.
+class StringDictionary {
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    StringDictionary() {
+        intern("");
+    }
+
+    uint32_t intern(const string& value) {
+        auto it = ids.find(value);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        uint32_t id = values.size();
+        values.push_back(value);
+        ids[value] = id;
+        return id;
+    }
+
+    uint32_t find(const string& value) const {
+        auto it = ids.find(value);
+        return it == ids.end() ? NOT_FOUND : it->second;
+    }
+
+    const string& lookup(uint32_t id) const {
+        return values[id];
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    // One value per line, in id order from firstId; values never contain
+    // newlines
+    string serialize(size_t firstId = 1) const {
+        string data;
+        for (size_t id = firstId; id < values.size(); id++) {
+            data += values[id];
+            data += '\n';
+        }
+        return data;
+    }
+
+    void load(const string& data) {
+        stringstream ss(data);
+        string value;
+        while (getline(ss, value)) {
+            values.push_back(value);
+            ids[value] = values.size() - 1;
+        }
+    }
+
+private:
+    vector<string> values;
+    unordered_map<string, uint32_t> ids;
+};
+
 struct Book {
     string ISBN;
     string bookName;
-    string author;
-    string keyword;
+    uint32_t authorId;            // id in authorDictionary
+    vector<uint32_t> keywordIds;  // ids in keywordDictionary, in input order
     double price;
     int stockQuantity;
+    // Cumulative sales counters, updated in place by buy/import
+    long long unitsSold;
+    long long revenueCents;
+    long long costCents;
+
+    Book(string isbn = "", string name = "", uint32_t authId = 0,
+         vector<uint32_t> kwIds = vector<uint32_t>(), double p = 0.0, int stock = 0)
+        : ISBN(isbn), bookName(name), authorId(authId), keywordIds(kwIds), price(p), stockQuantity(stock),
+          unitsSold(0), revenueCents(0), costCents(0) {}
+};
 
-    Book(string isbn = "", string name = "", string auth = "", string kw = "",
-         double p = 0.0, int stock = 0)
-        : ISBN(isbn), bookName(name), author(auth), keyword(kw), price(p), stockQuantity(stock) {}
+// Point-in-time view for reads: the books and journal entries that existed
+// when it was taken. Commands execute one at a time, so no write lands
+// while a read holds a snapshot and the two lengths are all it needs.
+struct Snapshot {
+    size_t bookCount;
+    size_t transactionCount;
 };
 
 struct Transaction {
     string type; // "buy" or "import"
-    double amount;
+    long long amountCents; // rounded once when recorded; imports negative
+    long long timestamp; // seconds since epoch, 0 for legacy records
+    string ISBN;
+    int quantity;
+
+    Transaction(string t = "", long long cents = 0, long long ts = 0, string isbn = "", int qty = 0)
+        : type(t), amountCents(cents), timestamp(ts), ISBN(isbn), quantity(qty) {}
+};
+
+// Fenwick index over the transaction journal, kept in cents so window
+// sums are exact. Appending is O(log n) and any range [from, to] of
+// transaction sequence numbers (1-based) is answered in O(log n).
+class FinanceIndex {
+public:
+    void append(long long incomeCents, long long expenditureCents) {
+        size_t pos = income.size() + 1;
+        long long incomeNode = incomeCents, expenditureNode = expenditureCents;
+        // Node pos covers (pos - lowbit(pos), pos]; fold in the child nodes.
+        for (size_t step = 1; step < (pos & (~pos + 1)); step <<= 1) {
+            incomeNode += income[pos - step - 1];
+            expenditureNode += expenditure[pos - step - 1];
+        }
+        income.push_back(incomeNode);
+        expenditure.push_back(expenditureNode);
+    }
+
+    size_t size() const { return income.size(); }
+
+    // Drop entries past length; earlier nodes never depend on later ones
+    void truncate(size_t length) {
+        income.resize(length);
+        expenditure.resize(length);
+    }
+
+    void range(size_t from, size_t to, long long& incomeCents, long long& expenditureCents) const {
+        incomeCents = prefix(income, to) - prefix(income, from - 1);
+        expenditureCents = prefix(expenditure, to) - prefix(expenditure, from - 1);
+    }
+
+private:
+    static long long prefix(const vector<long long>& tree, size_t pos) {
+        long long sum = 0;
+        for (; pos > 0; pos &= pos - 1) {
+            sum += tree[pos - 1];
+        }
+        return sum;
+    }
+
+    vector<long long> income;
+    vector<long long> expenditure;
+};
+
+// Bounded ISBN -> index cache in front of the book lookup (simplified 2Q).
+// New keys enter a small FIFO probation queue; keys seen again after being
+// evicted from it (tracked by a ghost queue) are admitted to the main LRU,
+// so one-off lookups cannot flush the hot set.
+class BookCache {
+public:
+    explicit BookCache(size_t capacity)
+        : probationCapacity(max<size_t>(1, capacity / 4)),
+          protectedCapacity(max<size_t>(1, capacity - capacity / 4)),
+          ghostCapacity(max<size_t>(1, capacity / 2)),
+          hits(0), misses(0) {}
+
+    bool lookup(const string& ISBN, size_t& index) {
+        auto it = entries.find(ISBN);
+        if (it == entries.end()) {
+            misses++;
+            return false;
+        }
+        if (it->second.isProtected) {
+            protectedQueue.splice(protectedQueue.begin(), protectedQueue, it->second.pos);
+        }
+        index = it->second.pos->second;
+        hits++;
+        return true;
+    }
+
+    void admit(const string& ISBN, size_t index) {
+        if (entries.count(ISBN)) {
+            return;
+        }
+        auto ghost = ghostIndex.find(ISBN);
+        if (ghost != ghostIndex.end()) {
+            ghostQueue.erase(ghost->second);
+            ghostIndex.erase(ghost);
+            if (protectedQueue.size() >= protectedCapacity) {
+                entries.erase(protectedQueue.back().first);
+                protectedQueue.pop_back();
+            }
+            protectedQueue.emplace_front(ISBN, index);
+            entries[ISBN] = {protectedQueue.begin(), true};
+            return;
+        }
+        if (probationQueue.size() >= probationCapacity) {
+            const string evicted = probationQueue.back().first;
+            entries.erase(evicted);
+            probationQueue.pop_back();
+            ghostQueue.push_front(evicted);
+            ghostIndex[evicted] = ghostQueue.begin();
+            if (ghostQueue.size() > ghostCapacity) {
+                ghostIndex.erase(ghostQueue.back());
+                ghostQueue.pop_back();
+            }
+        }
+        probationQueue.emplace_front(ISBN, index);
+        entries[ISBN] = {probationQueue.begin(), false};
+    }
+
+    void invalidate(const string& ISBN) {
+        auto it = entries.find(ISBN);
+        if (it != entries.end()) {
+            if (it->second.isProtected) {
+                protectedQueue.erase(it->second.pos);
+            } else {
+                probationQueue.erase(it->second.pos);
+            }
+            entries.erase(it);
+        }
+        auto ghost = ghostIndex.find(ISBN);
+        if (ghost != ghostIndex.end()) {
+            ghostQueue.erase(ghost->second);
+            ghostIndex.erase(ghost);
+        }
+    }
+
+    size_t getHits() const { return hits; }
+    size_t getLookups() const { return hits + misses; }
+
+    void clear() {
+        probationQueue.clear();
+        protectedQueue.clear();
+        ghostQueue.clear();
+        entries.clear();
+        ghostIndex.clear();
+    }
+
+private:
+    typedef list<pair<string, size_t>> Queue;
+    struct Entry {
+        Queue::iterator pos;
+        bool isProtected;
+    };
+
+    size_t probationCapacity;
+    size_t protectedCapacity;
+    size_t ghostCapacity;
+    Queue probationQueue;
+    Queue protectedQueue;
+    list<string> ghostQueue;
+    unordered_map<string, Entry> entries;
+    unordered_map<string, list<string>::iterator> ghostIndex;
+    size_t hits;
+    size_t misses;
+};
+
+// Counts and maxima by type over a range of the journal. Also used as the
+// zone map of each journal block. Sums come from FinanceIndex instead.
+struct FinanceAggregate {
+    size_t buyCount;
+    size_t importCount;
+    long long largestSaleCents;
+    long long largestImportCents;
+
+    FinanceAggregate()
+        : buyCount(0), importCount(0),
+          largestSaleCents(0), largestImportCents(0) {}
+
+    void merge(const FinanceAggregate& other) {
+        buyCount += other.buyCount;
+        importCount += other.importCount;
+        largestSaleCents = max(largestSaleCents, other.largestSaleCents);
+        largestImportCents = max(largestImportCents, other.largestImportCents);
+    }
+};
+
+// Column-wise transaction journal: a type bitmap (bit set = buy), signed
+// amounts in cents (imports negative) and the remaining row fields, split
+// into fixed-size blocks with a zone map per block. Counts and maxima fold
+// zone maps for whole blocks and only scan the partial blocks at either end.
+class TransactionStore {
+public:
+    TransactionStore() : rowCount(0) {}
+
+    void append(const Transaction& trans) {
+        long long amountCents = llabs(trans.amountCents);
+        size_t row = rowCount++;
+        if (row % 64 == 0) {
+            buyBitmap.push_back(0);
+        }
+        if (row % TRANSACTION_BLOCK_SIZE == 0) {
+            zoneMaps.push_back(FinanceAggregate());
+        }
+        bool isBuy = trans.type == "buy";
+        if (isBuy) {
+            buyBitmap.back() |= 1ULL << (row % 64);
+        }
+        amounts.push_back(isBuy ? amountCents : -amountCents);
+        timestamps.push_back(trans.timestamp);
+        quantities.push_back(trans.quantity);
+        isbns.push_back(trans.ISBN);
+        zoneMaps.back().merge(scan(row, row + 1));
+    }
+
+    size_t size() const { return rowCount; }
+
+    const vector<long long>& timestampColumn() const { return timestamps; }
+
+    // Drop rows past length and rebuild the zone map of the last block
+    void truncate(size_t length) {
+        if (length >= rowCount) {
+            return;
+        }
+        rowCount = length;
+        buyBitmap.resize((length + 63) / 64);
+        if (length % 64 != 0) {
+            buyBitmap.back() &= (1ULL << (length % 64)) - 1;
+        }
+        amounts.resize(length);
+        timestamps.resize(length);
+        quantities.resize(length);
+        isbns.resize(length);
+        zoneMaps.resize((length + TRANSACTION_BLOCK_SIZE - 1) / TRANSACTION_BLOCK_SIZE);
+        if (!zoneMaps.empty()) {
+            zoneMaps.back() = scan((zoneMaps.size() - 1) * TRANSACTION_BLOCK_SIZE, length);
+        }
+    }
+
+    // Rebuild a row, e.g. for persistence
+    Transaction at(size_t row) const {
+        bool isBuy = isBuyRow(row);
+        return Transaction(isBuy ? "buy" : "import", amounts[row], timestamps[row],
+                           isbns[row], quantities[row]);
+    }
+
+    // Totals over rows [begin, end)
+    FinanceAggregate aggregate(size_t begin, size_t end) const {
+        FinanceAggregate result;
+        while (begin < end) {
+            size_t block = begin / TRANSACTION_BLOCK_SIZE;
+            size_t blockEnd = min(end, (block + 1) * TRANSACTION_BLOCK_SIZE);
+            if (begin % TRANSACTION_BLOCK_SIZE == 0 && blockEnd - begin == TRANSACTION_BLOCK_SIZE) {
+                result.merge(zoneMaps[block]);
+            } else {
+                result.merge(scan(begin, blockEnd));
+            }
+            begin = blockEnd;
+        }
+        return result;
+    }
+
+private:
+    bool isBuyRow(size_t row) const {
+        return (buyBitmap[row / 64] >> (row % 64)) & 1;
+    }
+
+    // Branch-free kernel over a contiguous run of rows; the type bit is
+    // turned into a mask so the loop body auto-vectorizes
+    FinanceAggregate scan(size_t begin, size_t end) const {
+        FinanceAggregate result;
+        long long largestSale = 0, largestImport = 0;
+        long long buys = 0;
+        for (size_t row = begin; row < end; row++) {
+            long long buyMask = -(long long)((buyBitmap[row / 64] >> (row % 64)) & 1);
+            long long sale = amounts[row] & buyMask;
+            long long cost = -amounts[row] & ~buyMask;
+            largestSale = max(largestSale, sale);
+            largestImport = max(largestImport, cost);
+            buys -= buyMask;
+        }
+        result.buyCount = buys;
+        result.importCount = (end - begin) - buys;
+        result.largestSaleCents = largestSale;
+        result.largestImportCents = largestImport;
+        return result;
+    }
+
+    size_t rowCount;
+    vector<uint64_t> buyBitmap;
+    vector<long long> amounts;
+    vector<long long> timestamps;
+    vector<int> quantities;
+    vector<string> isbns;
+    vector<FinanceAggregate> zoneMaps;
+};
+
+// A contiguous run of pages inside the storage container
+struct Extent {
+    uint64_t startPage;
+    uint64_t pageCount;
+    uint64_t length; // bytes in use
+
+    Extent(uint64_t start = 0, uint64_t pages = 0, uint64_t len = 0)
+        : startPage(start), pageCount(pages), length(len) {}
+};
+
+// All persistent structures live in one paged container file so adding an
+// index never adds a file. Page 0 is the superblock; it points at the
+// catalog, which maps stream names to extents and records free extents.
+// Each stream occupies a single contiguous extent, so it is read and
+// written with one sequential I/O.
+//
+// Writes are copy-on-write: a rewritten stream goes to fresh pages and an
+// append only fills bytes past the stream's committed length. Committed
+// bytes stay untouched until the superblock points at the new catalog, so
+// until then the file on disk still describes the last committed state.
+class StorageContainer {
+public:
+    StorageContainer() : fd(-1), pageCount(1) {}
+
+    ~StorageContainer() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Returns true if an existing container was loaded and false if a new
+    // one was created. Throws rather than overwrite a file it cannot read.
+    bool open(const string& filePath) {
+        path = filePath;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw runtime_error(path + ": " + strerror(errno));
+        }
+
+        // A new file gets an empty superblock before any stream is written.
+        // A page 0 of zeros is a first run that crashed before that landed.
+        string page = readAt(0, STORAGE_PAGE_SIZE);
+        if (page.find_first_not_of('\0') == string::npos) {
+            writeSuperblock();
+            sync();
+            return false;
+        }
+        if (!readSuperblock(page)) {
+            throw runtime_error(path + " is not a bookstore storage file");
+        }
+        return true;
+    }
 
-    Transaction(string t = "", double a = 0.0)
-        : type(t), amount(a) {}
+    bool hasStream(const string& name) const {
+        return catalog.count(name) > 0;
+    }
+
+    string readStream(const string& name) {
+        auto it = catalog.find(name);
+        return it == catalog.end() ? "" : readExtent(it->second);
+    }
+
+    void writeStream(const string& name, const string& data) {
+        Extent fresh = allocate(pagesFor(data.size()));
+        fresh.length = data.size();
+        writeAt(fresh.startPage * STORAGE_PAGE_SIZE, data);
+
+        auto it = catalog.find(name);
+        if (it != catalog.end()) {
+            retire(it->second);
+        }
+        catalog[name] = fresh;
+    }
+
+    // Add data to the end of a stream. Bytes past the committed length are
+    // not part of the committed state, so they are written in place while
+    // the extent has room; otherwise the stream moves to an extent twice
+    // the size it needs.
+    void appendStream(const string& name, const string& data) {
+        auto it = catalog.find(name);
+        if (it == catalog.end()) {
+            writeStream(name, data);
+            return;
+        }
+        Extent& extent = it->second;
+        uint64_t length = extent.length + data.size();
+        if (length <= extent.pageCount * STORAGE_PAGE_SIZE) {
+            writeAt(extent.startPage * STORAGE_PAGE_SIZE + extent.length, data);
+            extent.length = length;
+            return;
+        }
+
+        Extent fresh = allocate(pagesFor(length) * 2);
+        fresh.length = length;
+        writeAt(fresh.startPage * STORAGE_PAGE_SIZE, readExtent(extent) + data);
+        retire(extent);
+        extent = fresh;
+    }
+
+    // Write the catalog to fresh pages and sync, then switch the superblock
+    // to it and sync again. A crash before the superblock write leaves the
+    // previous commit intact. Extents retired since the last commit become
+    // reusable afterwards.
+    void commit() {
+        retire(catalogExtent);
+        Extent fresh;
+        string data;
+        while (true) {
+            // The catalog lists the free extents, which the allocation itself
+            // changes, so allocate with slack and check the result still fits
+            data = serializeCatalog();
+            fresh = allocate(pagesFor(data.size()) + 1);
+            data = serializeCatalog();
+            if (pagesFor(data.size()) <= fresh.pageCount) {
+                break;
+            }
+            release(fresh);
+        }
+        fresh.length = data.size();
+        writeAt(fresh.startPage * STORAGE_PAGE_SIZE, data);
+        sync();
+
+        catalogExtent = fresh;
+        writeSuperblock();
+        sync();
+
+        for (const auto& entry : retiredExtents) {
+            release(Extent(entry.first, entry.second));
+        }
+        retiredExtents.clear();
+    }
+
+private:
+    static uint64_t pagesFor(uint64_t bytes) {
+        return (bytes + STORAGE_PAGE_SIZE - 1) / STORAGE_PAGE_SIZE;
+    }
+
+    // First fit from the free list, otherwise extend the file
+    Extent allocate(uint64_t pages) {
+        for (auto it = freeExtents.begin(); it != freeExtents.end(); ++it) {
+            if (it->second >= pages) {
+                Extent extent(it->first, pages);
+                uint64_t remaining = it->second - pages;
+                uint64_t next = it->first + pages;
+                freeExtents.erase(it);
+                if (remaining > 0) {
+                    freeExtents[next] = remaining;
+                }
+                return extent;
+            }
+        }
+        Extent extent(pageCount, pages);
+        pageCount += pages;
+        return extent;
+    }
+
+    // Hold back an extent the committed catalog may still reference
+    void retire(const Extent& extent) {
+        if (extent.pageCount > 0) {
+            retiredExtents[extent.startPage] = extent.pageCount;
+        }
+    }
+
+    // Return an extent to the free list, coalescing with its neighbours
+    void release(const Extent& extent) {
+        if (extent.pageCount == 0) {
+            return;
+        }
+        uint64_t start = extent.startPage, pages = extent.pageCount;
+        auto next = freeExtents.lower_bound(start);
+        if (next != freeExtents.end() && start + pages == next->first) {
+            pages += next->second;
+            next = freeExtents.erase(next);
+        }
+        if (next != freeExtents.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == start) {
+                prev->second += pages;
+                return;
+            }
+        }
+        freeExtents[start] = pages;
+    }
+
+    void writeAt(uint64_t offset, const string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = pwrite(fd, data.data() + written, data.size() - written, offset + written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw runtime_error(path + ": write failed");
+            }
+            written += n;
+        }
+    }
+
+    // Short reads past the end of the file leave zeros
+    string readAt(uint64_t offset, size_t size) {
+        string data(size, '\0');
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd, &data[done], size - done, offset + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        data.resize(done);
+        return data;
+    }
+
+    string readExtent(const Extent& extent) {
+        return readAt(extent.startPage * STORAGE_PAGE_SIZE, extent.length);
+    }
+
+    void sync() {
+        if (fsync(fd) != 0) {
+            throw runtime_error(path + ": fsync failed");
+        }
+    }
+
+    string serializeCatalog() const {
+        stringstream ss;
+        for (const auto& entry : catalog) {
+            ss << "stream " << entry.first << " " << entry.second.startPage << " "
+               << entry.second.pageCount << " " << entry.second.length << "\n";
+        }
+        // Retired extents are free once this catalog is committed
+        for (const auto& entry : freeExtents) {
+            ss << "free " << entry.first << " " << entry.second << "\n";
+        }
+        for (const auto& entry : retiredExtents) {
+            ss << "free " << entry.first << " " << entry.second << "\n";
+        }
+        return ss.str();
+    }
+
+    // The superblock fields fit in the first sector, so the switch to a new
+    // catalog is a single sector write
+    void writeSuperblock() {
+        string page(STORAGE_PAGE_SIZE, '\0');
+        uint64_t fields[4] = {pageCount, catalogExtent.startPage,
+                              catalogExtent.pageCount, catalogExtent.length};
+        memcpy(&page[0], STORAGE_MAGIC, sizeof(STORAGE_MAGIC));
+        memcpy(&page[sizeof(STORAGE_MAGIC)], fields, sizeof(fields));
+        writeAt(0, page);
+    }
+
+    bool readSuperblock(const string& page) {
+        if (page.size() < STORAGE_PAGE_SIZE || memcmp(page.data(), STORAGE_MAGIC, sizeof(STORAGE_MAGIC)) != 0) {
+            return false;
+        }
+        uint64_t fields[4];
+        memcpy(fields, page.data() + sizeof(STORAGE_MAGIC), sizeof(fields));
+        pageCount = fields[0];
+        catalogExtent = Extent(fields[1], fields[2], fields[3]);
+
+        stringstream ss(readExtent(catalogExtent));
+        string kind;
+        while (ss >> kind) {
+            if (kind == "stream") {
+                string name;
+                Extent extent;
+                ss >> name >> extent.startPage >> extent.pageCount >> extent.length;
+                catalog[name] = extent;
+            } else {
+                uint64_t start, pages;
+                ss >> start >> pages;
+                release(Extent(start, pages));
+            }
+        }
+        return true;
+    }
+
+    string path;
+    int fd;
+    uint64_t pageCount;
+    Extent catalogExtent;
+    map<string, Extent> catalog;
+    map<uint64_t, uint64_t> freeExtents;    // start page -> page count
+    map<uint64_t, uint64_t> retiredExtents; // freed by the pending commit
+};
+
+// Undo state for an open begin ... commit block. Commands inside the
+// block apply directly; rollback restores the state captured here.
+struct PendingTransaction {
+    bool active;
+    int privilege; // privilege that opened the block, needed to close it
+    vector<User> users;
+    size_t bookCount;
+    size_t journalLength;
+    map<size_t, Book> bookImages; // book index -> image before its first write
+
+    PendingTransaction() : active(false), privilege(0), bookCount(0), journalLength(0) {}
+};
+
+// What the container already holds, so a save only appends what changed.
+// The user and book streams are record logs: the latest record per user
+// id or book index wins.
+struct PersistState {
+    set<string> dirtyUsers;   // user ids added, changed or deleted since the last save
+    set<size_t> dirtyBooks;   // book indices created or written since the last save
+    size_t userRecords;       // records in the user stream, live or superseded
+    size_t bookRecords;
+    size_t journalLength;     // journal rows already saved
+    size_t authorCount;       // dictionary ids already saved
+    size_t keywordCount;
+
+    PersistState()
+        : userRecords(0), bookRecords(0), journalLength(0), authorCount(1), keywordCount(1) {}
+};
+
+// One input line, tokenized ahead of execution by the parser stage
+struct ParsedCommand {
+    bool isQuit; // the raw line is exactly "quit" or "exit"
+    vector<string> tokens;
 };
 
+// Bounded ring buffer connecting two pipeline stages. Either side may
+// close it: the producer at end of input, the consumer when it stops early.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : slots(capacity), head(0), count(0), closed(false) {}
+
+    // Blocks while full; returns false once the queue is closed
+    bool push(T item) {
+        unique_lock<mutex> lock(guard);
+        notFull.wait(lock, [this] { return count < slots.size() || closed; });
+        if (closed) {
+            return false;
+        }
+        slots[(head + count) % slots.size()] = move(item);
+        count++;
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks while empty; returns false once closed and drained
+    bool pop(T& item) {
+        unique_lock<mutex> lock(guard);
+        notEmpty.wait(lock, [this] { return count > 0 || closed; });
+        if (count == 0) {
+            return false;
+        }
+        item = move(slots[head]);
+        head = (head + 1) % slots.size();
+        count--;
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(guard);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    vector<T> slots;
+    size_t head;
+    size_t count;
+    bool closed;
+    mutex guard;
+    condition_variable notFull;
+    condition_variable notEmpty;
+};
+
+typedef BoundedQueue<string> ChunkQueue;
+typedef BoundedQueue<vector<ParsedCommand>> CommandQueue;
+
 // Global variables
 vector<User> users;
 vector<Book> books;
-vector<Transaction> transactions;
+TransactionStore transactions;
+FinanceIndex financeIndex;
 vector<string> loginStack;
 string selectedISBN = "";
-
-// File names
-const string USER_FILE = "users.dat";
-const string BOOK_FILE = "books.dat";
-const string TRANSACTION_FILE = "transactions.dat";
+BookCache bookCache(BOOK_CACHE_CAPACITY);
+// Books with sales keyed by (-metric, ISBN) -> book index, kept in sync on every buy
+map<pair<long long, string>, size_t> salesRanking;    // by units sold
+map<pair<long long, string>, size_t> revenueRanking;  // by revenue
+StorageContainer storage;
+StringDictionary authorDictionary;
+StringDictionary keywordDictionary;
+PendingTransaction pendingTransaction;
+PersistState persisted;
+
+// Per-structure files written before the storage container existed; read
+// once to migrate an old install
+const string LEGACY_USER_FILE = "users.dat";
+const string LEGACY_BOOK_FILE = "books.dat";
+const string LEGACY_TRANSACTION_FILE = "transactions.dat";
+
+// Storage container file and the streams inside it
+const string STORAGE_FILE = "bookstore.db";
+const string USER_STREAM = "users";
+const string BOOK_STREAM = "books";
+const string TRANSACTION_STREAM = "transactions";
+const string AUTHOR_STREAM = "authors";
+const string KEYWORD_STREAM = "keywords";
 
 // Function declarations
 void initializeSystem();
+bool importLegacyData();
 void loadData();
 void saveData();
-void processCommand(const string& command);
+string userRecord(const User& user);
+string bookRecord(size_t index);
+void markAllDirty();
+void readInput(int fd, shared_ptr<ChunkQueue> chunks);
+void readMappedInput(const char* data, size_t size, shared_ptr<ChunkQueue> chunks);
+void parseInput(shared_ptr<ChunkQueue> chunks, shared_ptr<CommandQueue> commands);
+void processCommand(const vector<string>& tokens);
 void executeSu(const vector<string>& tokens);
 void executeLogout();
 void executeRegister(const vector<string>& tokens);
@@ -77,120 +862,375 @@ void executeModify(const vector<string>& tokens);
 void executeImport(const vector<string>& tokens);
 void executeShowFinance(const vector<string>& tokens);
 void executeLog();
-void executeReportFinance();
+void executeReportFinance(const vector<string>& tokens);
 void executeReportEmployee();
+void executeReportTop(const vector<string>& tokens);
+void executeBegin(const vector<string>& tokens);
+void executeCommit(const vector<string>& tokens);
+void executeRollback(const vector<string>& tokens);
+void rollbackPendingTransaction();
 
 int getCurrentPrivilege();
 User* getCurrentUser();
 bool userExists(const string& userID);
 User* getUser(const string& userID);
+void recordTransaction(const Transaction& trans);
+long long toCents(double amount);
+void rankBook(size_t index);
+void unrankBook(const Book& book);
 bool bookExists(const string& ISBN);
 Book* getBook(const string& ISBN);
+Snapshot acquireSnapshot();
+void beginBookWrite(Book* book);
 vector<string> parseCommand(const string& command);
 string trim(const string& str);
+string unquote(const string& str);
+vector<uint32_t> internKeywords(const string& keyword);
+string keywordString(const Book& book);
 
-int main() {
-    initializeSystem();
+int main(int argc, char* argv[]) {
+    try {
+        initializeSystem();
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+
+    // Input pipeline: reader -> parser -> executor (this thread). A script
+    // file given as the only argument is memory-mapped instead of read.
+    auto chunks = make_shared<ChunkQueue>(INPUT_QUEUE_CAPACITY);
+    auto commands = make_shared<CommandQueue>(COMMAND_QUEUE_CAPACITY);
+
+    thread reader;
+    bool readingStdin = true;
+    if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            cerr << "Cannot open " << argv[1] << "\n";
+            return 1;
+        }
+        const char* data = nullptr;
+        if (info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                cerr << "Cannot map " << argv[1] << "\n";
+                return 1;
+            }
+            data = static_cast<const char*>(mapped);
+        }
+        close(fd);
+        reader = thread(readMappedInput, data, (size_t)info.st_size, chunks);
+        readingStdin = false;
+    } else {
+        reader = thread(readInput, STDIN_FILENO, chunks);
+    }
+    thread parser(parseInput, chunks, commands);
 
-    string line;
-    while (getline(cin, line)) {
-        if (line == "quit" || line == "exit") {
-            break;
+    vector<ParsedCommand> batch;
+    bool quit = false;
+    while (!quit && commands->pop(batch)) {
+        for (const auto& command : batch) {
+            if (command.isQuit) {
+                quit = true;
+                break;
+            }
+            processCommand(command.tokens);
         }
-        processCommand(line);
+        // The next pop may wait for input, as getline on a tied cin did
+        cout.flush();
+    }
+
+    // Stop the upstream stages if we quit before the end of input
+    commands->close();
+    chunks->close();
+    parser.join();
+    if (readingStdin) {
+        // The reader may be blocked on an interactive stdin; it only
+        // touches its own queue, which outlives it
+        reader.detach();
+    } else {
+        reader.join();
     }
 
+    // Changes from an unfinished begin block are discarded
+    if (pendingTransaction.active) {
+        rollbackPendingTransaction();
+    }
     saveData();
     return 0;
 }
 
 void initializeSystem() {
-    // Check if this is first run by checking if user file exists
-    ifstream userFile(USER_FILE);
-    if (!userFile.good()) {
+    if (storage.open(STORAGE_FILE) && storage.hasStream(USER_STREAM)) {
+        loadData();
+        return;
+    }
+
+    // No container yet: migrate the per-structure files of an older install
+    if (!importLegacyData()) {
         // First run - create root user
         User root(ROOT_USERNAME, ROOT_PASSWORD, "root", ROOT_PRIVILEGE);
         users.push_back(root);
-        saveData();
-    } else {
-        loadData();
     }
+    markAllDirty();
+    saveData();
+}
+
+// Load users.dat/books.dat/transactions.dat as written before the storage
+// container. Returns false if there is no legacy install to import.
+bool importLegacyData() {
+    ifstream userFile(LEGACY_USER_FILE);
+    if (!userFile.good()) {
+        return false;
+    }
+
+    string line;
+    while (getline(userFile, line)) {
+        stringstream ss(line);
+        string id, pwd, name;
+        int priv;
+        if (ss >> id >> pwd >> name >> priv) {
+            users.push_back(User(id, pwd, name, priv));
+        }
+    }
+
+    // Books stored raw field values, quotes included; sales counters are optional
+    ifstream bookFile(LEGACY_BOOK_FILE);
+    while (getline(bookFile, line)) {
+        stringstream ss(line);
+        string isbn, name, auth, kw;
+        double price;
+        int stock;
+        if (!(ss >> isbn >> name >> auth >> kw >> price >> stock)) {
+            continue;
+        }
+        Book book(isbn, unquote(name), authorDictionary.intern(unquote(auth)),
+                  internKeywords(unquote(kw)), price, stock);
+        ss >> book.unitsSold >> book.revenueCents >> book.costCents;
+        books.push_back(book);
+        rankBook(books.size() - 1);
+    }
+
+    // Timestamp, quantity and ISBN columns are optional
+    ifstream transFile(LEGACY_TRANSACTION_FILE);
+    while (getline(transFile, line)) {
+        stringstream ss(line);
+        string type;
+        double amount;
+        long long timestamp = 0;
+        int quantity = 0;
+        string isbn;
+        if (!(ss >> type >> amount)) {
+            continue;
+        }
+        ss >> timestamp >> quantity >> isbn;
+        recordTransaction(Transaction(type, toCents(amount), timestamp, isbn, quantity));
+    }
+    return true;
 }
 
 void loadData() {
-    // Load users
-    ifstream userFile(USER_FILE);
-    if (userFile.is_open()) {
+    // Replay user records: "+ id pwd name priv" adds or updates in place,
+    // "- id" deletes, which keeps the order the users were added in
+    {
+        stringstream userStream(storage.readStream(USER_STREAM));
+        vector<User> replayed;
+        vector<bool> live;
+        unordered_map<string, size_t> positions;
         string line;
-        while (getline(userFile, line)) {
+        while (getline(userStream, line)) {
             stringstream ss(line);
-            string id, pwd, name;
-            int priv;
-            ss >> id >> pwd >> name >> priv;
-            User user(id, pwd, name, priv);
-            users.push_back(user);
+            string op, id, pwd, name;
+            int priv = 1;
+            ss >> op >> id >> pwd >> name >> priv;
+            persisted.userRecords++;
+            auto it = positions.find(id);
+            if (op == "-") {
+                if (it != positions.end()) {
+                    live[it->second] = false;
+                    positions.erase(it);
+                }
+            } else if (it != positions.end()) {
+                replayed[it->second] = User(id, pwd, name, priv);
+            } else {
+                positions[id] = replayed.size();
+                replayed.push_back(User(id, pwd, name, priv));
+                live.push_back(true);
+            }
+        }
+        for (size_t i = 0; i < replayed.size(); i++) {
+            if (live[i]) {
+                users.push_back(replayed[i]);
+            }
         }
-        userFile.close();
     }
 
-    // Load books
-    ifstream bookFile(BOOK_FILE);
-    if (bookFile.is_open()) {
+    // Load dictionaries before the books that reference them
+    authorDictionary.load(storage.readStream(AUTHOR_STREAM));
+    keywordDictionary.load(storage.readStream(KEYWORD_STREAM));
+    persisted.authorCount = authorDictionary.size();
+    persisted.keywordCount = keywordDictionary.size();
+
+    // Replay book records; the latest record for an index wins
+    {
+        stringstream bookStream(storage.readStream(BOOK_STREAM));
         string line;
-        while (getline(bookFile, line)) {
+        while (getline(bookStream, line)) {
             stringstream ss(line);
-            string isbn, name, auth, kw;
-            double price;
-            int stock;
-            ss >> isbn >> name >> auth >> kw >> price >> stock;
-            Book book(isbn, name, auth, kw, price, stock);
-            books.push_back(book);
+            size_t index;
+            Book book;
+            size_t keywordCount = 0;
+            ss >> index >> book.ISBN >> book.price >> book.stockQuantity >> book.unitsSold
+               >> book.revenueCents >> book.costCents >> book.authorId >> keywordCount;
+            book.keywordIds.resize(keywordCount);
+            for (auto& id : book.keywordIds) {
+                ss >> id;
+            }
+            // The name is the rest of the line and may be empty
+            ss.get();
+            getline(ss, book.bookName);
+            if (index >= books.size()) {
+                books.resize(index + 1);
+            }
+            books[index] = book;
+            persisted.bookRecords++;
+        }
+        for (size_t i = 0; i < books.size(); i++) {
+            rankBook(i);
         }
-        bookFile.close();
     }
 
     // Load transactions
-    ifstream transFile(TRANSACTION_FILE);
-    if (transFile.is_open()) {
+    {
+        stringstream transStream(storage.readStream(TRANSACTION_STREAM));
         string line;
-        while (getline(transFile, line)) {
+        while (getline(transStream, line)) {
             stringstream ss(line);
             string type;
             double amount;
-            ss >> type >> amount;
-            Transaction trans(type, amount);
-            transactions.push_back(trans);
+            long long timestamp = 0;
+            int quantity = 0;
+            string isbn;
+            ss >> type >> amount >> timestamp >> quantity >> isbn;
+            Transaction trans(type, toCents(amount), timestamp, isbn, quantity);
+            recordTransaction(trans);
         }
-        transFile.close();
+        persisted.journalLength = transactions.size();
     }
 }
 
+// Append what changed since the last save and commit it in one superblock
+// switch. A record stream is rewritten in full once superseded records
+// outnumber live ones.
 void saveData() {
+    bool changed = false;
+
     // Save users
-    ofstream userFile(USER_FILE);
-    for (const auto& user : users) {
-        userFile << user.userID << " " << user.password << " "
-                 << user.username << " " << user.privilege << "\n";
+    if (!persisted.dirtyUsers.empty()) {
+        string data;
+        if (persisted.userRecords + persisted.dirtyUsers.size() > 2 * users.size() + STREAM_COMPACT_SLACK) {
+            for (const auto& user : users) {
+                data += userRecord(user);
+            }
+            storage.writeStream(USER_STREAM, data);
+            persisted.userRecords = users.size();
+        } else {
+            unordered_map<string, const User*> byId;
+            for (const auto& user : users) {
+                byId[user.userID] = &user;
+            }
+            for (const auto& id : persisted.dirtyUsers) {
+                auto it = byId.find(id);
+                data += it != byId.end() ? userRecord(*it->second) : "- " + id + "\n";
+            }
+            storage.appendStream(USER_STREAM, data);
+            persisted.userRecords += persisted.dirtyUsers.size();
+        }
+        persisted.dirtyUsers.clear();
+        changed = true;
+    }
+
+    // Save dictionary values added since the last save
+    if (authorDictionary.size() > persisted.authorCount) {
+        storage.appendStream(AUTHOR_STREAM, authorDictionary.serialize(persisted.authorCount));
+        persisted.authorCount = authorDictionary.size();
+        changed = true;
+    }
+    if (keywordDictionary.size() > persisted.keywordCount) {
+        storage.appendStream(KEYWORD_STREAM, keywordDictionary.serialize(persisted.keywordCount));
+        persisted.keywordCount = keywordDictionary.size();
+        changed = true;
+    }
+
+    // Save books; indices past the end were created by a rolled-back block
+    persisted.dirtyBooks.erase(persisted.dirtyBooks.lower_bound(books.size()),
+                               persisted.dirtyBooks.end());
+    if (!persisted.dirtyBooks.empty()) {
+        string data;
+        if (persisted.bookRecords + persisted.dirtyBooks.size() > 2 * books.size() + STREAM_COMPACT_SLACK) {
+            for (size_t i = 0; i < books.size(); i++) {
+                data += bookRecord(i);
+            }
+            storage.writeStream(BOOK_STREAM, data);
+            persisted.bookRecords = books.size();
+        } else {
+            for (size_t index : persisted.dirtyBooks) {
+                data += bookRecord(index);
+            }
+            storage.appendStream(BOOK_STREAM, data);
+            persisted.bookRecords += persisted.dirtyBooks.size();
+        }
+        persisted.dirtyBooks.clear();
+        changed = true;
+    }
+
+    // Save journal rows recorded since the last save
+    if (transactions.size() > persisted.journalLength) {
+        stringstream transFile;
+        for (size_t i = persisted.journalLength; i < transactions.size(); i++) {
+            Transaction trans = transactions.at(i);
+            transFile << trans.type << " " << fixed << setprecision(2)
+                      << trans.amountCents / 100.0 << " " << trans.timestamp << " "
+                      << trans.quantity << " " << trans.ISBN << "\n";
+        }
+        storage.appendStream(TRANSACTION_STREAM, transFile.str());
+        persisted.journalLength = transactions.size();
+        changed = true;
     }
-    userFile.close();
 
-    // Save books
-    ofstream bookFile(BOOK_FILE);
-    for (const auto& book : books) {
-        bookFile << book.ISBN << " " << book.bookName << " "
-                 << book.author << " " << book.keyword << " "
-                 << fixed << setprecision(2) << book.price << " "
-                 << book.stockQuantity << "\n";
+    if (changed) {
+        storage.commit();
     }
-    bookFile.close();
+}
+
+string userRecord(const User& user) {
+    return "+ " + user.userID + " " + user.password + " " + user.username + " "
+           + to_string(user.privilege) + "\n";
+}
+
+string bookRecord(size_t index) {
+    const Book& book = books[index];
+    stringstream ss;
+    ss << index << " " << book.ISBN << " " << fixed << setprecision(2) << book.price << " "
+       << book.stockQuantity << " " << book.unitsSold << " "
+       << book.revenueCents << " " << book.costCents << " "
+       << book.authorId << " " << book.keywordIds.size();
+    for (uint32_t id : book.keywordIds) {
+        ss << " " << id;
+    }
+    ss << " " << book.bookName << "\n";
+    return ss.str();
+}
 
-    // Save transactions
-    ofstream transFile(TRANSACTION_FILE);
-    for (const auto& trans : transactions) {
-        transFile << trans.type << " " << fixed << setprecision(2)
-                  << trans.amount << "\n";
+// A new container holds nothing yet, so everything in memory is a change
+void markAllDirty() {
+    for (const auto& user : users) {
+        persisted.dirtyUsers.insert(user.userID);
+    }
+    for (size_t i = 0; i < books.size(); i++) {
+        persisted.dirtyBooks.insert(i);
     }
-    transFile.close();
 }
 
 string trim(const string& str) {
@@ -200,6 +1240,35 @@ string trim(const string& str) {
     return str.substr(start, end - start + 1);
 }
 
+// Strip the double quotes around a -name/-author/-keyword value
+string unquote(const string& str) {
+    if (str.size() >= 2 && str.front() == '"' && str.back() == '"') {
+        return str.substr(1, str.size() - 2);
+    }
+    return str;
+}
+
+vector<uint32_t> internKeywords(const string& keyword) {
+    vector<uint32_t> ids;
+    stringstream ss(keyword);
+    string segment;
+    while (getline(ss, segment, '|')) {
+        ids.push_back(keywordDictionary.intern(segment));
+    }
+    return ids;
+}
+
+string keywordString(const Book& book) {
+    string keyword;
+    for (size_t i = 0; i < book.keywordIds.size(); i++) {
+        if (i > 0) {
+            keyword += '|';
+        }
+        keyword += keywordDictionary.lookup(book.keywordIds[i]);
+    }
+    return keyword;
+}
+
 vector<string> parseCommand(const string& command) {
     vector<string> tokens;
     string trimmed = trim(command);
@@ -216,9 +1285,80 @@ vector<string> parseCommand(const string& command) {
     return tokens;
 }
 
-void processCommand(const string& command) {
-    vector<string> tokens = parseCommand(command);
+void readInput(int fd, shared_ptr<ChunkQueue> chunks) {
+    while (true) {
+        string chunk(INPUT_CHUNK_SIZE, '\0');
+        ssize_t bytes = read(fd, &chunk[0], chunk.size());
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        chunk.resize(bytes);
+        if (!chunks->push(move(chunk))) {
+            break;
+        }
+    }
+    chunks->close();
+}
+
+void readMappedInput(const char* data, size_t size, shared_ptr<ChunkQueue> chunks) {
+    for (size_t offset = 0; offset < size; offset += INPUT_CHUNK_SIZE) {
+        if (!chunks->push(string(data + offset, min(INPUT_CHUNK_SIZE, size - offset)))) {
+            break;
+        }
+    }
+    chunks->close();
+}
+
+// Split chunks into lines the same way getline does and tokenize them.
+// Parsing stops after quit/exit since nothing later is executed.
+void parseInput(shared_ptr<ChunkQueue> chunks, shared_ptr<CommandQueue> commands) {
+    vector<ParsedCommand> batch;
+    string line;
+    string chunk;
+    bool running = true;
+
+    auto emit = [&](const string& text) {
+        bool isQuit = text == "quit" || text == "exit";
+        batch.push_back({isQuit, isQuit ? vector<string>() : parseCommand(text)});
+        if (isQuit || batch.size() == COMMAND_BATCH_SIZE) {
+            running = commands->push(move(batch)) && !isQuit;
+            batch.clear();
+        }
+    };
+
+    while (running && chunks->pop(chunk)) {
+        size_t start = 0, end;
+        while (running && (end = chunk.find('\n', start)) != string::npos) {
+            line.append(chunk, start, end - start);
+            emit(line);
+            line.clear();
+            start = end + 1;
+        }
+        line.append(chunk, start, string::npos);
+
+        // Hand over what this chunk completed before blocking for the next
+        // one, so an interactive session sees each reply right away
+        if (running && !batch.empty()) {
+            running = commands->push(move(batch));
+            batch.clear();
+        }
+    }
+
+    // A final line without a trailing newline still counts
+    if (running && !line.empty()) {
+        emit(line);
+    }
+    if (running && !batch.empty()) {
+        commands->push(move(batch));
+    }
+    chunks->close();
+    commands->close();
+}
 
+void processCommand(const vector<string>& tokens) {
     if (tokens.empty()) {
         return;
     }
@@ -252,14 +1392,22 @@ void processCommand(const string& command) {
             executeModify(tokens);
         } else if (cmd == "import") {
             executeImport(tokens);
+        } else if (cmd == "begin") {
+            executeBegin(tokens);
+        } else if (cmd == "commit") {
+            executeCommit(tokens);
+        } else if (cmd == "rollback") {
+            executeRollback(tokens);
         } else if (cmd == "log") {
             executeLog();
         } else if (cmd == "report") {
             if (tokens.size() > 1) {
                 if (tokens[1] == "finance") {
-                    executeReportFinance();
+                    executeReportFinance(tokens);
                 } else if (tokens[1] == "employee") {
                     executeReportEmployee();
+                } else if (tokens[1] == "top" || tokens[1] == "revenue") {
+                    executeReportTop(tokens);
                 } else {
                     cout << "Invalid\n";
                 }
@@ -336,6 +1484,7 @@ void executeRegister(const vector<string>& tokens) {
 
     User newUser(userID, password, username, 1);
     users.push_back(newUser);
+    persisted.dirtyUsers.insert(userID);
 }
 
 void executePasswd(const vector<string>& tokens) {
@@ -371,6 +1520,7 @@ void executePasswd(const vector<string>& tokens) {
         }
         user->password = newPassword;
     }
+    persisted.dirtyUsers.insert(userID);
 }
 
 void executeUseradd(const vector<string>& tokens) {
@@ -406,6 +1556,7 @@ void executeUseradd(const vector<string>& tokens) {
 
     User newUser(userID, password, username, privilege);
     users.push_back(newUser);
+    persisted.dirtyUsers.insert(userID);
 }
 
 void executeDelete(const vector<string>& tokens) {
@@ -441,6 +1592,7 @@ void executeDelete(const vector<string>& tokens) {
             break;
         }
     }
+    persisted.dirtyUsers.insert(userID);
 }
 
 void executeShow(const vector<string>& tokens) {
@@ -449,54 +1601,49 @@ void executeShow(const vector<string>& tokens) {
         return;
     }
 
-    vector<Book> results;
+    // No filter: all books match
+    function<bool(const Book&)> matches = [](const Book&) { return true; };
 
-    if (tokens.size() == 1) {
-        // Show all books
-        results = books;
-    } else {
+    if (tokens.size() > 1) {
         // Show with filter
         string filter = tokens[1];
 
         if (filter.find("-ISBN=") == 0) {
             string ISBN = filter.substr(6);
-            for (const auto& book : books) {
-                if (book.ISBN == ISBN) {
-                    results.push_back(book);
-                }
-            }
+            matches = [ISBN](const Book& book) { return book.ISBN == ISBN; };
         } else if (filter.find("-name=") == 0) {
-            string name = filter.substr(6);
-            for (const auto& book : books) {
-                if (book.bookName == name) {
-                    results.push_back(book);
-                }
-            }
+            string name = unquote(filter.substr(6));
+            matches = [name](const Book& book) { return book.bookName == name; };
         } else if (filter.find("-author=") == 0) {
-            string author = filter.substr(8);
-            for (const auto& book : books) {
-                if (book.author == author) {
-                    results.push_back(book);
-                }
-            }
+            // Unknown authors match nothing; known ones compare by id
+            uint32_t authorId = authorDictionary.find(unquote(filter.substr(8)));
+            matches = [authorId](const Book& book) { return book.authorId == authorId; };
         } else if (filter.find("-keyword=") == 0) {
-            string keyword = filter.substr(9);
+            string keyword = unquote(filter.substr(9));
             // Check if keyword contains multiple keywords
             if (keyword.find('|') != string::npos) {
                 cout << "Invalid\n";
                 return;
             }
-            for (const auto& book : books) {
-                if (book.keyword.find(keyword) != string::npos) {
-                    results.push_back(book);
-                }
-            }
+            uint32_t keywordId = keywordDictionary.find(keyword);
+            matches = [keywordId](const Book& book) {
+                return find(book.keywordIds.begin(), book.keywordIds.end(), keywordId) != book.keywordIds.end();
+            };
         } else {
             cout << "Invalid\n";
             return;
         }
     }
 
+    // Read the catalog as of a single point in time
+    Snapshot snapshot = acquireSnapshot();
+    vector<Book> results;
+    for (size_t i = 0; i < snapshot.bookCount; i++) {
+        if (matches(books[i])) {
+            results.push_back(books[i]);
+        }
+    }
+
     // Sort by ISBN
     sort(results.begin(), results.end(),
          [](const Book& a, const Book& b) { return a.ISBN < b.ISBN; });
@@ -504,7 +1651,7 @@ void executeShow(const vector<string>& tokens) {
     // Output results
     for (const auto& book : results) {
         cout << book.ISBN << "\t" << book.bookName << "\t"
-             << book.author << "\t" << book.keyword << "\t"
+             << authorDictionary.lookup(book.authorId) << "\t" << keywordString(book) << "\t"
              << fixed << setprecision(2) << book.price << "\t"
              << book.stockQuantity << "\n";
     }
@@ -544,14 +1691,22 @@ void executeBuy(const vector<string>& tokens) {
         return;
     }
 
-    double total = book->price * quantity;
+    // Rounded to cents once; the printed total, the journal and the
+    // finance index all use this value
+    long long totalCents = toCents(book->price * quantity);
+    beginBookWrite(book);
     book->stockQuantity -= quantity;
 
+    unrankBook(*book);
+    book->unitsSold += quantity;
+    book->revenueCents += totalCents;
+    rankBook(book - &books[0]);
+
     // Record transaction
-    Transaction trans("buy", total);
-    transactions.push_back(trans);
+    Transaction trans("buy", totalCents, time(nullptr), ISBN, quantity);
+    recordTransaction(trans);
 
-    cout << fixed << setprecision(2) << total << "\n";
+    cout << fixed << setprecision(2) << totalCents / 100.0 << "\n";
 }
 
 void executeSelect(const vector<string>& tokens) {
@@ -571,6 +1726,7 @@ void executeSelect(const vector<string>& tokens) {
         // Create new book
         Book newBook(ISBN);
         books.push_back(newBook);
+        persisted.dirtyBooks.insert(books.size() - 1);
     }
 
     selectedISBN = ISBN;
@@ -598,6 +1754,8 @@ void executeModify(const vector<string>& tokens) {
         return;
     }
 
+    beginBookWrite(book);
+
     // Check for duplicate parameters
     map<string, bool> paramUsed;
 
@@ -620,8 +1778,11 @@ void executeModify(const vector<string>& tokens) {
                 cout << "Invalid\n";
                 return;
             }
+            bookCache.invalidate(book->ISBN);
+            unrankBook(*book);
             book->ISBN = newISBN;
             selectedISBN = newISBN;
+            rankBook(book - &books[0]);
 
         } else if (token.find("-name=") == 0) {
             if (paramUsed["name"]) {
@@ -630,7 +1791,7 @@ void executeModify(const vector<string>& tokens) {
             }
             paramUsed["name"] = true;
 
-            string name = token.substr(6);
+            string name = unquote(token.substr(6));
             book->bookName = name;
 
         } else if (token.find("-author=") == 0) {
@@ -640,8 +1801,8 @@ void executeModify(const vector<string>& tokens) {
             }
             paramUsed["author"] = true;
 
-            string author = token.substr(8);
-            book->author = author;
+            string author = unquote(token.substr(8));
+            book->authorId = authorDictionary.intern(author);
 
         } else if (token.find("-keyword=") == 0) {
             if (paramUsed["keyword"]) {
@@ -650,7 +1811,7 @@ void executeModify(const vector<string>& tokens) {
             }
             paramUsed["keyword"] = true;
 
-            string keyword = token.substr(9);
+            string keyword = unquote(token.substr(9));
             // Check for duplicate segments
             vector<string> segments;
             stringstream ss(keyword);
@@ -662,7 +1823,7 @@ void executeModify(const vector<string>& tokens) {
                 }
                 segments.push_back(segment);
             }
-            book->keyword = keyword;
+            book->keywordIds = internKeywords(keyword);
 
         } else if (token.find("-price=") == 0) {
             if (paramUsed["price"]) {
@@ -711,11 +1872,14 @@ void executeImport(const vector<string>& tokens) {
         return;
     }
 
+    long long costCents = toCents(totalCost);
+    beginBookWrite(book);
     book->stockQuantity += quantity;
+    book->costCents += costCents;
 
     // Record transaction
-    Transaction trans("import", -totalCost);
-    transactions.push_back(trans);
+    Transaction trans("import", -costCents, time(nullptr), book->ISBN, quantity);
+    recordTransaction(trans);
 }
 
 void executeShowFinance(const vector<string>& tokens) {
@@ -724,9 +1888,12 @@ void executeShowFinance(const vector<string>& tokens) {
         return;
     }
 
-    int count = transactions.size();
-    if (tokens.size() > 1) {
-        count = stoi(tokens[1]);
+    Snapshot snapshot = acquireSnapshot();
+    int total = snapshot.transactionCount;
+
+    int count = total;
+    if (tokens.size() > 2) {
+        count = stoi(tokens[2]);
     }
 
     if (count < 0) {
@@ -734,7 +1901,7 @@ void executeShowFinance(const vector<string>& tokens) {
         return;
     }
 
-    if (count > (int)transactions.size()) {
+    if (count > total) {
         cout << "Invalid\n";
         return;
     }
@@ -744,20 +1911,12 @@ void executeShowFinance(const vector<string>& tokens) {
         return;
     }
 
-    double income = 0.0, expenditure = 0.0;
+    // Sum the last 'count' transactions from the prefix index
+    long long income, expenditure;
+    financeIndex.range(total - count + 1, total, income, expenditure);
 
-    // Get last 'count' transactions
-    int startIdx = max(0, (int)transactions.size() - count);
-    for (int i = startIdx; i < (int)transactions.size(); i++) {
-        if (transactions[i].type == "buy") {
-            income += transactions[i].amount;
-        } else if (transactions[i].type == "import") {
-            expenditure += abs(transactions[i].amount);
-        }
-    }
-
-    cout << "+ " << fixed << setprecision(2) << income
-         << " - " << fixed << setprecision(2) << expenditure << "\n";
+    cout << "+ " << fixed << setprecision(2) << income / 100.0
+         << " - " << fixed << setprecision(2) << expenditure / 100.0 << "\n";
 }
 
 void executeLog() {
@@ -767,32 +1926,92 @@ void executeLog() {
     }
 
     // Simple log implementation
+    Snapshot snapshot = acquireSnapshot();
     cout << "=== System Log ===\n";
     cout << "Total users: " << users.size() << "\n";
-    cout << "Total books: " << books.size() << "\n";
-    cout << "Total transactions: " << transactions.size() << "\n";
+    cout << "Total books: " << snapshot.bookCount << "\n";
+    cout << "Total transactions: " << snapshot.transactionCount << "\n";
+
+    size_t lookups = bookCache.getLookups();
+    double hitRate = lookups ? 100.0 * bookCache.getHits() / lookups : 0.0;
+    cout << "Book cache hits: " << bookCache.getHits() << "/" << lookups
+         << " (" << fixed << setprecision(2) << hitRate << "%)\n";
 }
 
-void executeReportFinance() {
+void executeReportFinance(const vector<string>& tokens) {
     if (getCurrentPrivilege() != 7) {
         cout << "Invalid\n";
         return;
     }
 
-    cout << "=== Financial Report ===\n";
-    double totalIncome = 0.0, totalExpenditure = 0.0;
+    // Reports only see the journal prefix committed when they started
+    Snapshot snapshot = acquireSnapshot();
+    size_t total = snapshot.transactionCount;
+    const vector<long long>& timestamps = transactions.timestampColumn();
+
+    // report finance (hourly|daily): per-bucket breakdown by timestamp
+    if (tokens.size() == 3) {
+        long long width;
+        if (tokens[2] == "hourly") {
+            width = 3600;
+        } else if (tokens[2] == "daily") {
+            width = 86400;
+        } else {
+            cout << "Invalid\n";
+            return;
+        }
+
+        cout << "=== Financial Report (" << tokens[2] << ", UTC) ===\n";
+        size_t begin = 0;
+        while (begin < total) {
+            long long bucketStart = timestamps[begin] - timestamps[begin] % width;
+            // The journal is appended in time order, so each bucket is a contiguous run
+            size_t end = lower_bound(timestamps.begin() + begin, timestamps.begin() + total,
+                                     bucketStart + width) - timestamps.begin();
+
+            long long income, expenditure;
+            financeIndex.range(begin + 1, end, income, expenditure);
+
+            time_t start = bucketStart;
+            char label[32];
+            strftime(label, sizeof(label), width == 3600 ? "%Y-%m-%d %H:00" : "%Y-%m-%d", gmtime(&start));
+            cout << label << "\t+ " << fixed << setprecision(2) << income / 100.0
+                 << " - " << expenditure / 100.0 << "\n";
+            begin = end;
+        }
+        return;
+    }
 
-    for (const auto& trans : transactions) {
-        if (trans.type == "buy") {
-            totalIncome += trans.amount;
-        } else if (trans.type == "import") {
-            totalExpenditure += abs(trans.amount);
+    // report finance [from] [to]: window of transaction sequence numbers
+    size_t from = 1, to = total;
+    if (tokens.size() == 4) {
+        long long first = stoll(tokens[2]), last = stoll(tokens[3]);
+        if (first < 1 || first > last || last > (long long)total) {
+            cout << "Invalid\n";
+            return;
         }
+        from = first;
+        to = last;
+        cout << "=== Financial Report (transactions " << from << "-" << to << ") ===\n";
+    } else if (tokens.size() == 2) {
+        cout << "=== Financial Report ===\n";
+    } else {
+        cout << "Invalid\n";
+        return;
+    }
+
+    // Sums from the prefix index; counts and maxima from the zone maps
+    long long totalIncome = 0, totalExpenditure = 0;
+    if (from <= to) {
+        financeIndex.range(from, to, totalIncome, totalExpenditure);
     }
+    FinanceAggregate summary = transactions.aggregate(from - 1, to);
 
-    cout << "Total Income: " << fixed << setprecision(2) << totalIncome << "\n";
-    cout << "Total Expenditure: " << fixed << setprecision(2) << totalExpenditure << "\n";
-    cout << "Net Profit: " << fixed << setprecision(2) << (totalIncome - totalExpenditure) << "\n";
+    cout << "Total Income: " << fixed << setprecision(2) << totalIncome / 100.0 << "\n";
+    cout << "Total Expenditure: " << fixed << setprecision(2) << totalExpenditure / 100.0 << "\n";
+    cout << "Net Profit: " << fixed << setprecision(2) << (totalIncome - totalExpenditure) / 100.0 << "\n";
+    cout << "Sales: " << summary.buyCount << " (largest " << summary.largestSaleCents / 100.0 << ")\n";
+    cout << "Imports: " << summary.importCount << " (largest " << summary.largestImportCents / 100.0 << ")\n";
 }
 
 void executeReportEmployee() {
@@ -811,6 +2030,130 @@ void executeReportEmployee() {
     }
 }
 
+void executeReportTop(const vector<string>& tokens) {
+    if (tokens.size() > 3) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    if (getCurrentPrivilege() != 7) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    int count = DEFAULT_TOP_COUNT;
+    if (tokens.size() == 3) {
+        count = stoi(tokens[2]);
+    }
+
+    if (count < 0) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    // report top ranks by units sold, report revenue by revenue
+    bool byRevenue = tokens[1] == "revenue";
+    const auto& ranking = byRevenue ? revenueRanking : salesRanking;
+
+    // Like show, only books that existed when the report started
+    Snapshot snapshot = acquireSnapshot();
+    cout << (byRevenue ? "=== Top Revenue ===\n" : "=== Top Sellers ===\n");
+    int rank = 0;
+    for (auto it = ranking.begin(); it != ranking.end() && rank < count; ++it) {
+        if (it->second >= snapshot.bookCount) {
+            continue;
+        }
+        const Book* book = &books[it->second];
+        rank++;
+        cout << rank << ". " << book->ISBN << "\t" << book->unitsSold << " sold"
+             << "\t+ " << fixed << setprecision(2) << book->revenueCents / 100.0
+             << " - " << book->costCents / 100.0 << "\n";
+    }
+}
+
+void executeBegin(const vector<string>& tokens) {
+    if (tokens.size() != 1) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    if (getCurrentPrivilege() < 3) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    // Blocks do not nest
+    if (pendingTransaction.active) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    pendingTransaction.active = true;
+    pendingTransaction.privilege = getCurrentPrivilege();
+    pendingTransaction.users = users;
+    pendingTransaction.bookCount = books.size();
+    pendingTransaction.journalLength = transactions.size();
+    pendingTransaction.bookImages.clear();
+}
+
+void executeCommit(const vector<string>& tokens) {
+    if (tokens.size() != 1 || !pendingTransaction.active
+        || getCurrentPrivilege() < pendingTransaction.privilege) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    pendingTransaction = PendingTransaction();
+    // One durable write for the whole block
+    saveData();
+}
+
+void executeRollback(const vector<string>& tokens) {
+    if (tokens.size() != 1 || !pendingTransaction.active
+        || getCurrentPrivilege() < pendingTransaction.privilege) {
+        cout << "Invalid\n";
+        return;
+    }
+
+    rollbackPendingTransaction();
+}
+
+void rollbackPendingTransaction() {
+    users = pendingTransaction.users;
+
+    // Restore books written inside the block; their first write already
+    // marked them for the next save
+    for (const auto& entry : pendingTransaction.bookImages) {
+        unrankBook(books[entry.first]);
+        books[entry.first] = entry.second;
+        rankBook(entry.first);
+    }
+
+    // Drop books created inside the block
+    while (books.size() > pendingTransaction.bookCount) {
+        unrankBook(books.back());
+        books.pop_back();
+    }
+
+    transactions.truncate(pendingTransaction.journalLength);
+    financeIndex.truncate(pendingTransaction.journalLength);
+
+    // ISBNs may have moved, so cached handles are no longer trustworthy
+    bookCache.clear();
+    pendingTransaction = PendingTransaction();
+
+    // A rollback never logs anyone in. Logins of users the block created
+    // end as a logout would, and a selected book the block created or
+    // renamed is deselected.
+    size_t loginCount = loginStack.size();
+    loginStack.erase(remove_if(loginStack.begin(), loginStack.end(),
+                               [](const string& userID) { return !userExists(userID); }),
+                     loginStack.end());
+    if (loginStack.size() != loginCount || (!selectedISBN.empty() && !bookExists(selectedISBN))) {
+        selectedISBN = "";
+    }
+}
+
 // Helper functions
 int getCurrentPrivilege() {
     if (loginStack.empty()) {
@@ -840,14 +2183,66 @@ User* getUser(const string& userID) {
     return nullptr;
 }
 
+long long toCents(double amount) {
+    return llround(amount * 100);
+}
+
+void recordTransaction(const Transaction& trans) {
+    long long amountCents = llabs(trans.amountCents);
+    transactions.append(trans);
+    if (trans.type == "buy") {
+        financeIndex.append(amountCents, 0);
+    } else {
+        financeIndex.append(0, amountCents);
+    }
+}
+
+// Add books[index] to the rankings; pair with unrankBook() around any
+// change to its ISBN or sales counters
+void rankBook(size_t index) {
+    const Book& book = books[index];
+    if (book.unitsSold > 0) {
+        salesRanking[make_pair(-book.unitsSold, book.ISBN)] = index;
+    }
+    if (book.revenueCents > 0) {
+        revenueRanking[make_pair(-book.revenueCents, book.ISBN)] = index;
+    }
+}
+
+void unrankBook(const Book& book) {
+    salesRanking.erase(make_pair(-book.unitsSold, book.ISBN));
+    revenueRanking.erase(make_pair(-book.revenueCents, book.ISBN));
+}
+
+Snapshot acquireSnapshot() {
+    Snapshot snapshot = {books.size(), transactions.size()};
+    return snapshot;
+}
+
+// Called by writers before mutating a book in place. Keeps the image an
+// open begin block may roll back to and marks the book for the next save.
+void beginBookWrite(Book* book) {
+    size_t index = book - &books[0];
+    if (pendingTransaction.active && index < pendingTransaction.bookCount
+        && !pendingTransaction.bookImages.count(index)) {
+        pendingTransaction.bookImages[index] = *book;
+    }
+    persisted.dirtyBooks.insert(index);
+}
+
 bool bookExists(const string& ISBN) {
     return getBook(ISBN) != nullptr;
 }
 
 Book* getBook(const string& ISBN) {
-    for (auto& book : books) {
-        if (book.ISBN == ISBN) {
-            return &book;
+    size_t index;
+    if (bookCache.lookup(ISBN, index)) {
+        return &books[index];
+    }
+    for (size_t i = 0; i < books.size(); i++) {
+        if (books[i].ISBN == ISBN) {
+            bookCache.admit(ISBN, i);
+            return &books[i];
         }
     }
     return nullptr;
@@ -0,0 +1,118 @@
+#!/bin/sh
+# Checks report finance windows and hourly/daily buckets, and that the
+# printed buy total, show finance and a restart agree to the cent.
+# Usage: finance_reports.sh <path-to-code>
+set -e
+
+binary="$1"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+# A total on a half cent is rounded once, the same way everywhere
+mkdir rounding && cd rounding
+"$binary" > actual.txt <<'INPUT'
+su root sjtu
+select A
+modify -price=0.125
+import 10 1
+buy A 1
+buy A 3
+show finance
+quit
+INPUT
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+show finance
+report finance 2 3
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+0.13
+0.38
++ 0.51 - 1.00
++ 0.51 - 1.00
+=== Financial Report (transactions 2-3) ===
+Total Income: 0.51
+Total Expenditure: 0.00
+Net Profit: 0.51
+Sales: 2 (largest 0.38)
+Imports: 0 (largest 0.00)
+OUTPUT
+
+diff expected.txt actual.txt
+cd ..
+
+# A journal with fixed timestamps, imported from the legacy files
+mkdir buckets && cd buckets
+echo "root sjtu root 7" > users.dat
+cat > transactions.dat <<'DATA'
+import -100.00 1700000000 10 A
+buy 12.50 1700000100 1 A
+buy 7.25 1700003700 1 A
+buy 30.00 1700090000 2 A
+import -40.00 1700090500 4 A
+DATA
+"$binary" > actual.txt <<'INPUT'
+su root sjtu
+report finance
+report finance 2 4
+report finance 0 2
+report finance 3 2
+report finance 1 6
+report finance hourly
+report finance daily
+report finance weekly
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+=== Financial Report ===
+Total Income: 49.75
+Total Expenditure: 140.00
+Net Profit: -90.25
+Sales: 3 (largest 30.00)
+Imports: 2 (largest 100.00)
+=== Financial Report (transactions 2-4) ===
+Total Income: 49.75
+Total Expenditure: 0.00
+Net Profit: 49.75
+Sales: 3 (largest 30.00)
+Imports: 0 (largest 0.00)
+Invalid
+Invalid
+Invalid
+=== Financial Report (hourly, UTC) ===
+2023-11-14 22:00	+ 12.50 - 100.00
+2023-11-14 23:00	+ 7.25 - 0.00
+2023-11-15 23:00	+ 30.00 - 40.00
+=== Financial Report (daily, UTC) ===
+2023-11-14	+ 19.75 - 100.00
+2023-11-15	+ 30.00 - 40.00
+Invalid
+OUTPUT
+
+diff expected.txt actual.txt
+cd ..
+
+# Windows that span several journal blocks against a plain sum
+mkdir windows && cd windows
+echo "root sjtu root 7" > users.dat
+awk 'BEGIN {
+    for (i = 1; i <= 10000; i++) {
+        if (i % 7 == 0) printf "import -%d.%02d\n", i % 50, i % 100
+        else printf "buy %d.%02d\n", i % 30, i % 100
+    }
+}' > transactions.dat
+for window in "1 10000" "100 4200" "4096 4097" "5000 9000"; do
+    set -- $window
+    echo "su root sjtu
+report finance $1 $2" | "$binary" | sed -n 's/^Total //p' > actual.txt
+    awk -v from="$1" -v to="$2" 'NR >= from && NR <= to {
+        cents = int($2 * 100 + ($2 < 0 ? -0.5 : 0.5))
+        if ($1 == "buy") income += cents; else expenditure -= cents
+    } END {
+        printf "Income: %d.%02d\nExpenditure: %d.%02d\n",
+            income / 100, income % 100, expenditure / 100, expenditure % 100
+    }' transactions.dat > expected.txt
+    diff expected.txt actual.txt
+done
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Checks that replies reach a client on an open pipe before it sends quit.
+# Usage: interactive_pipe.sh <path-to-code>
+set -e
+
+binary="$1"
+workdir=$(mktemp -d)
+trap 'exec 3>&-; rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+mkfifo input
+"$binary" < input > actual.txt &
+exec 3> input
+printf 'su root sjtu\nselect 1\nimport 5 10\nshow finance\n' >&3
+
+# The pipe stays open, so the reply must arrive without end of input
+tries=0
+while [ "$(cat actual.txt)" != "+ 0.00 - 10.00" ]; do
+    tries=$((tries + 1))
+    if [ "$tries" -gt 50 ]; then
+        echo "no reply before quit"
+        printf 'quit\n' >&3
+        exit 1
+    fi
+    sleep 0.1
+done
+
+printf 'quit\n' >&3
+exec 3>&-
+wait
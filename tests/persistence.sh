@@ -0,0 +1,128 @@
+#!/bin/sh
+# Checks that state survives restarts: user deletes and re-adds, record
+# stream compaction, and the one-time import of legacy .dat files.
+# Usage: persistence.sh <path-to-code>
+set -e
+
+binary="$1"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+# Print one stream of bookstore.db by following the superblock to the catalog
+stream() {
+    set -- "$1" $(od -An -tu8 -j8 -N32 bookstore.db)
+    dd if=bookstore.db bs=4096 skip="$3" count="$4" 2>/dev/null | head -c "$5" > catalog.txt
+    set -- $(grep "^stream $1 " catalog.txt)
+    dd if=bookstore.db bs=4096 skip="$3" count="$4" 2>/dev/null | head -c "$5"
+}
+
+# Users deleted and re-added across restarts come back in their last state
+mkdir roundtrip && cd roundtrip
+"$binary" > actual.txt <<'INPUT'
+su root sjtu
+useradd alice pa 3 Alice
+useradd bob pb 1 Bob
+register carol pc Carol
+delete alice
+passwd bob nb
+select X
+modify -name="Dune" -author="Herbert" -keyword="sf|classic" -price=2.50
+import 10 5
+quit
+INPUT
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+delete bob
+useradd alice pa2 1 Alice2
+su carol pc
+buy X 2
+quit
+INPUT
+"$binary" >> actual.txt <<'INPUT'
+su alice pa
+su alice pa2
+logout
+su bob nb
+su carol pc
+logout
+su root sjtu
+show
+show finance
+quit
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+5.00
+Invalid
+Invalid
+X	Dune	Herbert	sf|classic	2.50	8
++ 5.00 - 5.00
+OUTPUT
+
+diff expected.txt actual.txt
+cd ..
+
+# Superseded user and book records are compacted; journal rows all stay
+mkdir compaction && cd compaction
+{
+    echo "su root sjtu"
+    i=0
+    while [ "$i" -lt 100 ]; do
+        printf 'begin\npasswd root sjtu\nselect X\nimport 1 1\ncommit\n'
+        i=$((i + 1))
+    done
+} | "$binary" > actual.txt
+[ "$(stream users | wc -l)" -le 66 ]
+[ "$(stream books | wc -l)" -le 66 ]
+[ "$(stream transactions | wc -l)" -eq 100 ]
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+show
+show finance
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+X				0.00	100
++ 0.00 - 100.00
+OUTPUT
+
+diff expected.txt actual.txt
+cd ..
+
+# Files written before the storage container are imported once
+mkdir legacy && cd legacy
+cat > users.dat <<'DATA'
+root sjtu root 7
+clerk cpw Clerk 3
+reader rpw Reader 1
+DATA
+cat > books.dat <<'DATA'
+978-1 "Dune" "Herbert" "sf|classic" 12.50 7
+DATA
+cat > transactions.dat <<'DATA'
+import -80.00
+buy 37.50
+DATA
+"$binary" > actual.txt <<'INPUT'
+su reader rpw
+buy 978-1 1
+su clerk cpw
+show
+show finance
+quit
+INPUT
+# The .dat files are still there but must not be imported twice
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+show finance
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+12.50
+978-1	Dune	Herbert	sf|classic	12.50	6
+Invalid
++ 50.00 - 80.00
+OUTPUT
+
+diff expected.txt actual.txt
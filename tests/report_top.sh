@@ -0,0 +1,89 @@
+#!/bin/sh
+# Checks report top/revenue ordering, including re-ranking after
+# modify -ISBN, after a rolled-back block and after a restart.
+# Usage: report_top.sh <path-to-code>
+set -e
+
+binary="$1"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+"$binary" > actual.txt <<'INPUT'
+su root sjtu
+select A
+modify -price=2.00
+import 10 4
+select B
+modify -price=5.00
+import 10 8
+select C
+modify -price=1.00
+import 10 1
+buy A 3
+buy B 1
+buy C 3
+report top
+report revenue
+select A
+modify -ISBN=Z
+report top
+report revenue
+buy Z 1
+report top 2
+begin
+select Z
+modify -ISBN=Y
+buy Y 5
+rollback
+report top
+report top 0
+report top -1
+quit
+INPUT
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+report top
+report revenue 1
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+6.00
+5.00
+3.00
+=== Top Sellers ===
+1. A	3 sold	+ 6.00 - 4.00
+2. C	3 sold	+ 3.00 - 1.00
+3. B	1 sold	+ 5.00 - 8.00
+=== Top Revenue ===
+1. A	3 sold	+ 6.00 - 4.00
+2. B	1 sold	+ 5.00 - 8.00
+3. C	3 sold	+ 3.00 - 1.00
+=== Top Sellers ===
+1. C	3 sold	+ 3.00 - 1.00
+2. Z	3 sold	+ 6.00 - 4.00
+3. B	1 sold	+ 5.00 - 8.00
+=== Top Revenue ===
+1. Z	3 sold	+ 6.00 - 4.00
+2. B	1 sold	+ 5.00 - 8.00
+3. C	3 sold	+ 3.00 - 1.00
+2.00
+=== Top Sellers ===
+1. Z	4 sold	+ 8.00 - 4.00
+2. C	3 sold	+ 3.00 - 1.00
+10.00
+=== Top Sellers ===
+1. Z	4 sold	+ 8.00 - 4.00
+2. C	3 sold	+ 3.00 - 1.00
+3. B	1 sold	+ 5.00 - 8.00
+=== Top Sellers ===
+Invalid
+=== Top Sellers ===
+1. Z	4 sold	+ 8.00 - 4.00
+2. C	3 sold	+ 3.00 - 1.00
+3. B	1 sold	+ 5.00 - 8.00
+=== Top Revenue ===
+1. Z	4 sold	+ 8.00 - 4.00
+OUTPUT
+
+diff expected.txt actual.txt
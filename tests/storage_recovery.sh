@@ -0,0 +1,55 @@
+#!/bin/sh
+# Checks that a crash during a save leaves a container the next run can
+# open, and that a foreign file is refused rather than overwritten.
+# Usage: storage_recovery.sh <path-to-code>
+set -e
+
+binary="$1"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+# A first run that crashed before its superblock landed leaves page 0 zeroed
+head -c 8192 /dev/zero > bookstore.db
+"$binary" > actual.txt <<'INPUT'
+su root sjtu
+select A
+import 2 3.00
+quit
+INPUT
+
+# A crash just before the superblock switch: the new stream pages are on
+# disk but page 0 still points at the previous commit
+cp bookstore.db committed.db
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+select B
+import 4 1.00
+useradd c1 pw 3 C1
+quit
+INPUT
+dd if=committed.db of=bookstore.db bs=4096 count=1 conv=notrunc 2>/dev/null
+
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+show
+show finance
+su c1 pw
+quit
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+A				0.00	2
++ 0.00 - 3.00
+Invalid
+OUTPUT
+
+diff expected.txt actual.txt
+
+# Anything else is refused and left untouched
+printf 'not a container\n' > bookstore.db
+if "$binary" < /dev/null 2> /dev/null; then
+    echo "foreign file was accepted"
+    exit 1
+fi
+[ "$(cat bookstore.db)" = "not a container" ]
@@ -0,0 +1,80 @@
+#!/bin/sh
+# Checks that rollback restores books and users, drops logins and the
+# selection it invalidates, and never logs anyone back in.
+# Usage: transaction_rollback.sh <path-to-code>
+set -e
+
+binary="$1"
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+cd "$workdir"
+
+"$binary" > actual.txt <<'INPUT'
+su root sjtu
+select A
+modify -price=1.00
+begin
+modify -ISBN=Z
+select B
+rollback
+modify -price=5.00
+show
+logout
+su root sjtu
+begin
+select N
+rollback
+modify -price=2.00
+begin
+useradd u1 pw 1 U1
+su u1 pw
+rollback
+su root sjtu
+rollback
+report employee
+logout
+su u1 pw
+select A
+begin
+import 3 9.99
+rollback
+modify -price=5.00
+show finance
+begin
+logout
+rollback
+report employee
+su root sjtu
+rollback
+report employee
+quit
+INPUT
+
+# Rolled-back state must also stay gone after a restart
+"$binary" >> actual.txt <<'INPUT'
+su root sjtu
+show
+show finance
+INPUT
+
+cat > expected.txt <<'OUTPUT'
+Invalid
+A				1.00	0
+Invalid
+Invalid
+=== Employee Work Report ===
+Currently logged in users: 2
+- root (root) - Privilege: 7
+- root (root) - Privilege: 7
+Invalid
+
+Invalid
+Invalid
+=== Employee Work Report ===
+Currently logged in users: 1
+- root (root) - Privilege: 7
+A				5.00	0
+
+OUTPUT
+
+diff expected.txt actual.txt